@@ -2,7 +2,15 @@
 #include <cstddef>
 #include <iostream>
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // Function to test thread safety by creating and destroying many vectors
 void stress_test_thread_safety(int iterations) {
@@ -79,8 +87,1285 @@ void test_joinable_fixes() {
     std::cout << "All joinable() fix tests passed!" << std::endl;
 }
 
-int main()
+// Function to test Lp_where and Lp_filter against a serial scan
+void test_compaction() {
+    std::cout << "\nTesting Lp_where and Lp_filter..." << std::endl;
+    Lp_parallel_vector<int> vec(100000);
+    vec.fill([](int& val, size_t index) { (void)val; return static_cast<int>((index * 7919) % 1000); });
+
+    Lp_parallel_vector<size_t> indices = Lp_where(vec < 100);
+    Lp_parallel_vector<int> values = Lp_filter(vec, vec < 100);
+
+    size_t expected = 0;
+    bool ok = indices.size() == values.size();
+    for (size_t i = 0; ok && i < vec.size(); i++) {
+        if (vec[i] < 100) {
+            ok = expected < indices.size() && indices[expected] == i && values[expected] == vec[i];
+            expected++;
+        }
+    }
+    ok = ok && expected == indices.size();
+    std::cout << (ok ? "Lp_where/Lp_filter passed!" : "Error: Lp_where/Lp_filter mismatch") << std::endl;
+}
+
+// Function to test gather, scatter, scatter-add and histogram against serial loops
+void test_gather_scatter() {
+    std::cout << "\nTesting Lp_gather, Lp_scatter, Lp_scatter_add and Lp_histogram..." << std::endl;
+    const size_t n = 100000;
+    Lp_parallel_vector<int> src(n);
+    src.fill([](int& val, size_t index) { (void)val; return static_cast<int>(index); });
+
+    // A permutation: gather then scatter must give back the source
+    Lp_parallel_vector<size_t> perm(n);
+    perm.fill([n](size_t& val, size_t index) { (void)val; return (index * 7919) % n; });
+    Lp_parallel_vector<int> gathered = Lp_gather(src, perm);
+    Lp_parallel_vector<int> scattered(n);
+    size_t conflicts = Lp_scatter(gathered, perm, scattered);
+    bool ok = conflicts == 0;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = gathered[i] == src[perm[i]] && scattered[i] == src[i];
+    std::cout << (ok ? "Lp_gather/Lp_scatter passed!" : "Error: Lp_gather/Lp_scatter mismatch") << std::endl;
+
+    // Duplicate indices: the last write wins, like the serial loop
+    Lp_parallel_vector<size_t> dup(n);
+    dup.fill([](size_t& val, size_t index) { (void)val; return index % 1000; });
+    Lp_parallel_vector<int> last(1000);
+    conflicts = Lp_scatter(src, dup, last);
+    ok = conflicts == n - 1000;
+    for (size_t i = 0; ok && i < 1000; i++)
+        ok = last[i] == static_cast<int>(n - 1000 + i);
+    std::cout << (ok ? "Lp_scatter conflict detection passed!" : "Error: Lp_scatter conflicts mismatch") << std::endl;
+
+    // Scatter-add into a small and a large target
+    for (size_t bins : {size_t(1000), size_t(1) << 20}) {
+        Lp_parallel_vector<int> ones(n);
+        ones.fill(1);
+        Lp_parallel_vector<size_t> keys(n);
+        keys.fill([bins](size_t& val, size_t index) { (void)val; return (index * 31) % bins; });
+        Lp_parallel_vector<int> sums(bins);
+        Lp_scatter_add(ones, keys, sums);
+        Lp_parallel_vector<size_t> counts = Lp_histogram(keys, bins);
+        std::vector<int> expected(bins, 0);
+        for (size_t i = 0; i < n; i++)
+            expected[keys[i]]++;
+        ok = true;
+        for (size_t i = 0; ok && i < bins; i++)
+            ok = sums[i] == expected[i] && counts[i] == static_cast<size_t>(expected[i]);
+        std::cout << (ok ? "Lp_scatter_add/Lp_histogram passed!" : "Error: Lp_scatter_add/Lp_histogram mismatch") << std::endl;
+    }
+}
+
+// Function to test Lp_argsort and Lp_sort_by_key against std::stable_sort
+void test_argsort() {
+    std::cout << "\nTesting Lp_argsort and Lp_sort_by_key..." << std::endl;
+    const size_t n = 200000;
+    Lp_parallel_vector<int> keys(n);
+    keys.fill([](int& val, size_t index) { (void)val; return static_cast<int>((index * 7919) % 5000); });
+
+    Lp_parallel_vector<size_t> perm = Lp_argsort(keys);
+    std::vector<size_t> expected(n);
+    for (size_t i = 0; i < n; i++)
+        expected[i] = i;
+    std::stable_sort(expected.begin(), expected.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+    bool ok = perm.size() == n;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = perm[i] == expected[i];
+    std::cout << (ok ? "Lp_argsort passed!" : "Error: Lp_argsort mismatch") << std::endl;
+
+    // Two payload columns follow the keys in descending order
+    Lp_parallel_vector<size_t> rows(n);
+    rows.fill([](size_t& val, size_t index) { (void)val; return index; });
+    Lp_parallel_vector<double> payload(n);
+    payload.fill([](double& val, size_t index) { (void)val; return index * 0.5; });
+    Lp_parallel_vector<int> sorted_keys = keys;
+    Lp_sort_by_key(sorted_keys, std::greater<int>(), rows, payload);
+    ok = true;
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = sorted_keys[i] == keys[rows[i]] && payload[i] == rows[i] * 0.5;
+        if (ok && i > 0)
+            ok = sorted_keys[i - 1] > sorted_keys[i] || (sorted_keys[i - 1] == sorted_keys[i] && rows[i - 1] < rows[i]);
+    }
+
+    // Keys alone, without value vectors
+    Lp_parallel_vector<int> keys_only = keys;
+    Lp_sort_by_key(keys_only);
+    std::vector<int> expected_keys(keys.begin(), keys.end());
+    std::sort(expected_keys.begin(), expected_keys.end());
+    ok = ok && std::equal(keys_only.begin(), keys_only.end(), expected_keys.begin());
+    std::cout << (ok ? "Lp_sort_by_key passed!" : "Error: Lp_sort_by_key mismatch") << std::endl;
+}
+
+// Function to test Lp_top_k, Lp_nth_element and Lp_partial_sort against std::sort
+void test_selection() {
+    std::cout << "\nTesting Lp_top_k, Lp_nth_element and Lp_partial_sort..." << std::endl;
+    const size_t n = 500000;
+    Lp_parallel_vector<long> vec(n);
+    vec.fill([](long& val, size_t index) { (void)val; return static_cast<long>((index * 2654435761u) % 100003); });
+    std::vector<long> sorted(vec.begin(), vec.end());
+    std::sort(sorted.begin(), sorted.end());
+
+    Lp_parallel_vector<long> top = Lp_top_k(vec, 100);
+    bool ok = top.size() == 100;
+    for (size_t i = 0; ok && i < 100; i++)
+        ok = top[i] == sorted[n - 1 - i];
+    std::cout << (ok ? "Lp_top_k passed!" : "Error: Lp_top_k mismatch") << std::endl;
+
+    ok = true;
+    for (size_t nth : {size_t(0), n / 100, n / 2, n - 1}) {
+        Lp_parallel_vector<long> work = vec;
+        long value = Lp_nth_element(work, nth);
+        ok = ok && value == sorted[nth] && work[nth] == sorted[nth] && Lp_nth_value(vec, nth) == sorted[nth];
+        for (size_t i = 0; ok && i < n; i++)
+            ok = i < nth ? work[i] <= value : work[i] >= value;
+    }
+    std::cout << (ok ? "Lp_nth_element passed!" : "Error: Lp_nth_element mismatch") << std::endl;
+
+    Lp_parallel_vector<long> work = vec;
+    Lp_partial_sort(work, 1000);
+    ok = true;
+    for (size_t i = 0; ok && i < 1000; i++)
+        ok = work[i] == sorted[i];
+    std::cout << (ok ? "Lp_partial_sort passed!" : "Error: Lp_partial_sort mismatch") << std::endl;
+}
+
+// Function to test batched searches and sorted set operations against the std algorithms
+void test_sorted_search() {
+    std::cout << "\nTesting batched searches and sorted set operations..." << std::endl;
+    const size_t n = 200000;
+    Lp_parallel_vector<int> a(n), b(n / 2), queries(n);
+    a.fill([](int& val, size_t index) { (void)val; return static_cast<int>(index / 3); });
+    b.fill([](int& val, size_t index) { (void)val; return static_cast<int>(index * 2 % 70001); });
+    queries.fill([](int& val, size_t index) { (void)val; return static_cast<int>((index * 7919) % 70000) - 10; });
+    std::sort(b.begin(), b.end());
+
+    Lp_parallel_vector<size_t> lower = Lp_lower_bound(a, queries);
+    Lp_parallel_vector<size_t> upper = Lp_upper_bound(a, queries);
+    Lp_parallel_vector<std::pair<size_t, size_t>> ranges = Lp_equal_range(b, queries);
+    bool ok = lower.size() == n && upper.size() == n && ranges.size() == n;
+    for (size_t i = 0; ok && i < n; i++) {
+        auto range = std::equal_range(b.begin(), b.end(), queries[i]);
+        ok = lower[i] == static_cast<size_t>(std::lower_bound(a.begin(), a.end(), queries[i]) - a.begin()) &&
+             upper[i] == static_cast<size_t>(std::upper_bound(a.begin(), a.end(), queries[i]) - a.begin()) &&
+             ranges[i].first == static_cast<size_t>(range.first - b.begin()) &&
+             ranges[i].second == static_cast<size_t>(range.second - b.begin());
+    }
+    std::cout << (ok ? "Lp_lower_bound/Lp_upper_bound/Lp_equal_range passed!" : "Error: batched search mismatch") << std::endl;
+
+    std::vector<int> expected;
+    std::merge(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    Lp_parallel_vector<int> merged = Lp_merge(a, b);
+    ok = std::equal(merged.begin(), merged.end(), expected.begin(), expected.end());
+    expected.clear();
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    Lp_parallel_vector<int> common = Lp_set_intersection(a, b);
+    ok = ok && std::equal(common.begin(), common.end(), expected.begin(), expected.end());
+    expected.clear();
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    Lp_parallel_vector<int> all = Lp_set_union(a, b);
+    ok = ok && std::equal(all.begin(), all.end(), expected.begin(), expected.end());
+    expected.clear();
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    Lp_parallel_vector<int> only_a = Lp_set_difference(a, b);
+    ok = ok && std::equal(only_a.begin(), only_a.end(), expected.begin(), expected.end());
+    std::cout << (ok ? "Lp_merge/Lp_set_intersection/Lp_set_union/Lp_set_difference passed!" : "Error: sorted set operation mismatch") << std::endl;
+}
+
+// Function to test Lp_group_by against a serial std::map aggregation
+void test_group_by() {
+    std::cout << "\nTesting Lp_group_by..." << std::endl;
+    const size_t n = 300000;
+    Lp_parallel_vector<int> keys(n);
+    Lp_parallel_vector<long> values(n);
+    keys.fill([](int& val, size_t index) { (void)val; return static_cast<int>((index * 2654435761u) % 5003); });
+    values.fill([](long& val, size_t index) { (void)val; return static_cast<long>(index % 1000) - 500; });
+
+    std::map<int, std::tuple<long, size_t, long, long>> expected;
+    for (size_t i = 0; i < n; i++) {
+        auto it = expected.find(keys[i]);
+        if (it == expected.end()) {
+            expected[keys[i]] = std::make_tuple(values[i], size_t(1), values[i], values[i]);
+        } else {
+            std::get<0>(it->second) += values[i];
+            std::get<1>(it->second) += 1;
+            std::get<2>(it->second) = std::min(std::get<2>(it->second), values[i]);
+            std::get<3>(it->second) = std::max(std::get<3>(it->second), values[i]);
+        }
+    }
+
+    auto sums = Lp_group_by(keys, values, Lp_sum_agg<long>());
+    bool ok = sums.keys.size() == expected.size() && sums.aggregates.size() == expected.size();
+    for (size_t i = 0; ok && i < sums.keys.size(); i++)
+        ok = std::get<0>(expected[sums.keys[i]]) == sums.aggregates[i];
+
+    auto stats = Lp_group_by(keys, Lp_aggregate(values, Lp_count_agg<long>()),
+                             Lp_aggregate(values, Lp_min_agg<long>()), Lp_aggregate(values, Lp_max_agg<long>()));
+    ok = ok && stats.keys.size() == expected.size();
+    for (size_t i = 0; ok && i < stats.keys.size(); i++) {
+        const auto& e = expected[stats.keys[i]];
+        ok = std::get<0>(stats.aggregates[i]) == std::get<1>(e) &&
+             std::get<1>(stats.aggregates[i]) == std::get<2>(e) &&
+             std::get<2>(stats.aggregates[i]) == std::get<3>(e);
+    }
+
+    // A short value column limits the rows that are grouped
+    const size_t m = n / 3;
+    Lp_parallel_vector<long> short_values;
+    short_values.assign(values.begin(), values.begin() + m);
+    std::map<int, long> short_expected;
+    for (size_t i = 0; i < m; i++)
+        short_expected[keys[i]] += values[i];
+    auto short_sums = Lp_group_by(keys, short_values, Lp_sum_agg<long>());
+    ok = ok && short_sums.keys.size() == short_expected.size();
+    for (size_t i = 0; ok && i < short_sums.keys.size(); i++)
+        ok = short_expected[short_sums.keys[i]] == short_sums.aggregates[i];
+    auto short_counts = Lp_group_by(keys, Lp_aggregate(values, Lp_count_agg<long>()),
+                                    Lp_aggregate(short_values, Lp_sum_agg<long>()));
+    size_t counted = 0;
+    for (size_t i = 0; i < short_counts.aggregates.size(); i++)
+        counted += std::get<0>(short_counts.aggregates[i]);
+    ok = ok && counted == m && short_counts.keys.size() == short_expected.size();
+    std::cout << (ok ? "Lp_group_by passed!" : "Error: Lp_group_by mismatch") << std::endl;
+}
+
+// Function to test the hash join, semi-join and anti-join against a serial std::multimap join
+void test_hash_join() {
+    std::cout << "\nTesting Lp_hash_join, Lp_semi_join and Lp_anti_join..." << std::endl;
+    Lp_parallel_vector<long> build(200000), probe(300000);
+    build.fill([](long& val, size_t index) { (void)val; return static_cast<long>((index * 2654435761u) % 150000); });
+    probe.fill([](long& val, size_t index) { (void)val; return static_cast<long>((index * 40503u) % 400000); });
+
+    std::multimap<long, size_t> build_map;
+    for (size_t i = 0; i < build.size(); i++)
+        build_map.insert({build[i], i});
+    std::vector<std::pair<size_t, size_t>> expected;
+    std::vector<size_t> semi, anti;
+    for (size_t i = 0; i < probe.size(); i++) {
+        auto range = build_map.equal_range(probe[i]);
+        for (auto it = range.first; it != range.second; ++it)
+            expected.push_back({it->second, i});
+        (range.first == range.second ? anti : semi).push_back(i);
+    }
+
+    Lp_join_result joined = Lp_hash_join(build, probe);
+    std::vector<std::pair<size_t, size_t>> pairs;
+    for (size_t i = 0; i < joined.build_indices.size(); i++)
+        pairs.push_back({joined.build_indices[i], joined.probe_indices[i]});
+    std::sort(pairs.begin(), pairs.end());
+    std::sort(expected.begin(), expected.end());
+    bool ok = pairs == expected;
+
+    Lp_parallel_vector<size_t> semi_rows = Lp_semi_join(probe, build);
+    Lp_parallel_vector<size_t> anti_rows = Lp_anti_join(probe, build);
+    ok = ok && std::equal(semi_rows.begin(), semi_rows.end(), semi.begin(), semi.end());
+    ok = ok && std::equal(anti_rows.begin(), anti_rows.end(), anti.begin(), anti.end());
+    std::cout << (ok ? "Lp_hash_join/Lp_semi_join/Lp_anti_join passed!" : "Error: hash join mismatch") << std::endl;
+}
+
+// Function to test Lp_unique, Lp_distinct, Lp_partition and Lp_stable_partition against the std algorithms
+void test_dedup_partition() {
+    std::cout << "\nTesting Lp_unique, Lp_distinct, Lp_partition and Lp_stable_partition..." << std::endl;
+    const size_t n = 300000;
+    Lp_parallel_vector<int> vec(n);
+    vec.fill([](int& val, size_t index) { (void)val; return static_cast<int>((index * 2654435761u) % 20011); });
+
+    Lp_parallel_vector<int> sorted = vec;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int> expected(sorted.begin(), sorted.end());
+    expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+    size_t unique_size = Lp_unique(sorted);
+    bool ok = unique_size == expected.size() && std::equal(sorted.begin(), sorted.end(), expected.begin(), expected.end());
+
+    std::vector<int> first_seen;
+    std::vector<bool> seen(20011, false);
+    for (size_t i = 0; i < n; i++) {
+        if (!seen[vec[i]]) {
+            seen[vec[i]] = true;
+            first_seen.push_back(vec[i]);
+        }
+    }
+    Lp_parallel_vector<int> distinct = Lp_distinct(vec);
+    ok = ok && std::equal(distinct.begin(), distinct.end(), first_seen.begin(), first_seen.end());
+    std::cout << (ok ? "Lp_unique/Lp_distinct passed!" : "Error: Lp_unique/Lp_distinct mismatch") << std::endl;
+
+    auto is_even = [](int x) { return x % 2 == 0; };
+    std::vector<int> stable(vec.begin(), vec.end());
+    auto stable_split = std::stable_partition(stable.begin(), stable.end(), is_even) - stable.begin();
+    Lp_parallel_vector<int> work = vec;
+    size_t split = Lp_stable_partition(work, is_even);
+    ok = split == static_cast<size_t>(stable_split) && std::equal(work.begin(), work.end(), stable.begin(), stable.end());
+
+    work = vec;
+    split = Lp_partition(work, is_even);
+    std::vector<int> before(vec.begin(), vec.end()), after(work.begin(), work.end());
+    std::sort(before.begin(), before.end());
+    std::sort(after.begin(), after.end());
+    ok = ok && split == static_cast<size_t>(stable_split) && before == after;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = is_even(work[i]) == (i < split);
+    std::cout << (ok ? "Lp_partition/Lp_stable_partition passed!" : "Error: Lp_partition/Lp_stable_partition mismatch") << std::endl;
+}
+
+void test_math() {
+    std::cout << "\nTesting element-wise math functions..." << std::endl;
+    const size_t n = 200000;
+    Lp_parallel_vector<double> x(n);
+    x.fill([](double& val, size_t index) { (void)val; return -20.0 + 40.0 * static_cast<double>(index) / n; });
+    Lp_parallel_vector<double> offset(n), twos(n);
+    offset.fill(1e-3);
+    twos.fill(2.0);
+    Lp_parallel_vector<double> positive = Lp_abs(x) + offset;
+
+    // Relative error bound of a few ULP, checked against the precise mode
+    auto close = [](const Lp_parallel_vector<double>& a, const Lp_parallel_vector<double>& b, double ulps) {
+        for (size_t i = 0; i < a.size(); i++) {
+            double scale = std::max(std::fabs(b[i]), std::numeric_limits<double>::min());
+            if (std::fabs(a[i] - b[i]) > ulps * std::numeric_limits<double>::epsilon() * scale)
+                return false;
+        }
+        return a.size() == b.size();
+    };
+    bool ok = close(Lp_exp(x, Lp_math_mode::fast), Lp_exp(x), 4)
+        && close(Lp_log(positive, Lp_math_mode::fast), Lp_log(positive), 4)
+        && close(Lp_sin(x, Lp_math_mode::fast), Lp_sin(x), 4)
+        && close(Lp_cos(x, Lp_math_mode::fast), Lp_cos(x), 4)
+        && close(Lp_tanh(x, Lp_math_mode::fast), Lp_tanh(x), 5)
+        && close(Lp_pow(positive, 1.5, Lp_math_mode::fast), Lp_pow(positive, 1.5), 64);
+    std::cout << (ok ? "Fast math within error bounds!" : "Error: fast math out of bounds") << std::endl;
+
+    Lp_parallel_vector<double> root = Lp_sqrt(positive);
+    Lp_parallel_vector<double> clamped = Lp_clamp(x, -1.0, 1.0);
+    Lp_parallel_vector<double> squares = Lp_pow(root, twos);
+    ok = true;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = root[i] == std::sqrt(positive[i]) && clamped[i] == std::clamp(x[i], -1.0, 1.0)
+            && std::fabs(squares[i] - positive[i]) <= 4 * std::numeric_limits<double>::epsilon() * positive[i];
+    Lp_parallel_vector<double> specials = {-0.0, 0.0, -2.5, -std::numeric_limits<double>::infinity(),
+                                           -std::numeric_limits<double>::quiet_NaN()};
+    Lp_parallel_vector<double> magnitudes = Lp_abs(specials);
+    for (size_t i = 0; ok && i < specials.size(); i++)
+        ok = !std::signbit(magnitudes[i]) && (magnitudes[i] == std::fabs(specials[i]) || std::isnan(magnitudes[i]));
+    Lp_parallel_vector<float> xf(n);
+    xf.fill([](float& val, size_t index) { (void)val; return static_cast<float>(index % 1000) * 0.01f - 5.0f; });
+    Lp_parallel_vector<float> ef = Lp_exp(xf, Lp_math_mode::fast);
+    for (size_t i = 0; ok && i < n; i++)
+        ok = std::fabs(ef[i] - std::exp(xf[i])) <= 2 * std::numeric_limits<float>::epsilon() * std::exp(xf[i]);
+    std::cout << (ok ? "Lp_sqrt/Lp_abs/Lp_clamp/Lp_pow/float exp passed!" : "Error: math function mismatch") << std::endl;
+}
+
+void test_blas1() {
+    std::cout << "\nTesting Lp_axpy, Lp_axpby, Lp_scal, Lp_fma, Lp_dot and Lp_nrm2..." << std::endl;
+    const size_t n = 100003;
+    Lp_parallel_vector<double> x(n), y(n), z(n);
+    x.fill([](double& val, size_t index) { (void)val; return static_cast<double>(index % 97) - 48.0; });
+    y.fill([](double& val, size_t index) { (void)val; return static_cast<double>(index % 13) * 0.5; });
+    z.fill(1.0);
+
+    Lp_parallel_vector<double> expected = x * 2.0 + y;
+    Lp_parallel_vector<double> work = y;
+    Lp_axpy(2.0, x, work);
+    bool ok = std::equal(work.begin(), work.end(), expected.begin(), expected.end());
+    work = y;
+    Lp_axpby(2.0, x, -1.0, work);
+    Lp_scal(0.5, work);
+    Lp_fma(x, y, z);
+    for (size_t i = 0; ok && i < n; i++)
+        ok = work[i] == x[i] - 0.5 * y[i] && z[i] == x[i] * y[i] + 1.0;
+    std::cout << (ok ? "Lp_axpy/Lp_axpby/Lp_scal/Lp_fma passed!" : "Error: in-place kernel mismatch") << std::endl;
+
+    // Small integer-valued terms: every mode must be exact
+    long double reference = 0;
+    for (size_t i = 0; i < n; i++)
+        reference += static_cast<long double>(x[i]) * y[i];
+    ok = Lp_dot(x, y) == static_cast<double>(reference) && Lp_dot(x, y, Lp_sum_mode::compensated) == static_cast<double>(reference);
+
+    // Large terms cancelling around small ones: only compensated summation
+    // recovers the small ones exactly
+    Lp_parallel_vector<double> cancel(n - n % 3);
+    cancel.fill([](double& val, size_t index) { (void)val; return index % 3 == 0 ? 1e17 : (index % 3 == 1 ? 1.0 : -1e17); });
+    ok = ok && Lp_sum(cancel, Lp_sum_mode::compensated) == static_cast<double>(n / 3);
+
+    Lp_parallel_vector<double> big(1000), tiny(1000);
+    big.fill(1e300);
+    tiny.fill(1e-300);
+    double root = std::sqrt(1000.0);
+    ok = ok && std::fabs(Lp_nrm2(big) / (1e300 * root) - 1) < 1e-14
+        && std::fabs(Lp_nrm2(tiny) / (1e-300 * root) - 1) < 1e-14
+        && Lp_nrm2(Lp_parallel_vector<double>{3.0, 4.0}) == 5.0;
+    std::cout << (ok ? "Lp_dot/Lp_sum/Lp_nrm2 passed!" : "Error: reduction mismatch") << std::endl;
+}
+
+void test_matrix() {
+    std::cout << "\nTesting Lp_parallel_matrix, Lp_gemm and Lp_gemv..." << std::endl;
+    const size_t m = 301, k = 517, n = 263;
+    Lp_parallel_matrix<double> a(m, k), b(k, n);
+    a.storage().fill([](double& val, size_t index) { (void)val; return static_cast<double>(index * 7 % 13) - 6.0; });
+    b.storage().fill([](double& val, size_t index) { (void)val; return static_cast<double>(index * 5 % 11) - 5.0; });
+
+    // Small integer values keep every product and sum exact
+    auto reference = [](const Lp_matrix_view<const double>& x, const Lp_matrix_view<const double>& y) {
+        Lp_parallel_matrix<double> r(x.rows, y.cols);
+        for (size_t i = 0; i < x.rows; i++)
+            for (size_t p = 0; p < x.cols; p++)
+                for (size_t j = 0; j < y.cols; j++)
+                    r(i, j) += x(i, p) * y(p, j);
+        return r;
+    };
+    auto same = [](const Lp_parallel_matrix<double>& x, const Lp_parallel_matrix<double>& y) {
+        return std::equal(x.storage().begin(), x.storage().end(), y.storage().begin(), y.storage().end());
+    };
+    Lp_parallel_matrix<double> c = Lp_matmul(a, b);
+    bool ok = same(c, reference(a.view(), b.view()));
+
+    // Transposed views and sub-blocks, with alpha and beta
+    const Lp_parallel_matrix<double> at = a.transpose();
+    ok = ok && at.rows() == k && at(5, 7) == a(7, 5);
+    Lp_parallel_matrix<double> d(m, n);
+    d.storage().fill(1.0);
+    Lp_gemm(2.0, at.view().transposed(), b.view(), 3.0, d.view());
+    for (size_t i = 0; ok && i < m * n; i++)
+        ok = d.storage()[i] == 2.0 * c.storage()[i] + 3.0;
+    Lp_parallel_matrix<double> part(100, 50);
+    Lp_gemm(1.0, a.block(10, 20, 100, 200), b.block(20, 30, 200, 50), 0.0, part.view());
+    ok = ok && same(part, reference(a.block(10, 20, 100, 200), b.block(20, 30, 200, 50)));
+    // Storage passed with std::move is adopted, an lvalue is copied
+    Lp_parallel_vector<double> cells = {1.5, 1.5, 1.5, 1.5, 1.5, 1.5};
+    Lp_parallel_matrix<double> copied(2, 3, cells);
+    const double* cells_data = cells.data();
+    Lp_parallel_matrix<double> adopted(2, 3, std::move(cells));
+    ok = ok && copied.data() != cells_data && adopted.data() == cells_data && adopted(1, 2) == 1.5;
+    std::cout << (ok ? "Lp_gemm/Lp_matmul/transpose passed!" : "Error: matrix product mismatch") << std::endl;
+
+    Lp_parallel_vector<double> x(k), y(m), yt(m);
+    x.fill([](double& val, size_t index) { (void)val; return static_cast<double>(index % 5); });
+    Lp_gemv(1.0, a.view(), x, 0.0, y);
+    Lp_gemv(1.0, at.view().transposed(), x, 0.0, yt);
+    ok = std::equal(y.begin(), y.end(), yt.begin(), yt.end());
+    for (size_t i = 0; ok && i < m; i++) {
+        double expected = 0;
+        for (size_t p = 0; p < k; p++)
+            expected += a(i, p) * x[p];
+        ok = y[i] == expected;
+    }
+    std::cout << (ok ? "Lp_gemv passed!" : "Error: Lp_gemv mismatch") << std::endl;
+}
+
+void test_sparse() {
+    std::cout << "\nTesting Lp_sparse_vector, Lp_csr_matrix and Lp_spmv..." << std::endl;
+    const size_t n = 50000;
+    Lp_parallel_vector<double> dense(n), other(n);
+    dense.fill([](double& val, size_t index) { (void)val; return index % 97 == 0 ? static_cast<double>(index % 7) + 1.0 : 0.0; });
+    other.fill([](double& val, size_t index) { (void)val; return static_cast<double>(index % 5); });
+
+    Lp_sparse_vector<double> sparse = Lp_to_sparse(dense);
+    Lp_sparse_vector<double> sparse_other = Lp_to_sparse(other);
+    Lp_parallel_vector<double> round_trip = Lp_to_dense(sparse);
+    bool ok = sparse.nnz() == (n + 96) / 97 && std::equal(dense.begin(), dense.end(), round_trip.begin(), round_trip.end());
+    double expected_dot = 0;
+    for (size_t i = 0; i < n; i++)
+        expected_dot += dense[i] * other[i];
+    ok = ok && Lp_dot(sparse, other) == expected_dot && Lp_dot(other, sparse) == expected_dot
+        && Lp_dot(sparse, sparse_other) == expected_dot;
+
+    Lp_parallel_vector<double> sum = sparse + other;
+    Lp_parallel_vector<double> diff = other - sparse;
+    Lp_sparse_vector<double> product = sparse * other;
+    Lp_parallel_vector<double> axpy = other;
+    Lp_axpy(2.0, sparse, axpy);
+    Lp_parallel_vector<double> product_dense = Lp_to_dense(product);
+    for (size_t i = 0; ok && i < n; i++)
+        ok = sum[i] == dense[i] + other[i] && diff[i] == other[i] - dense[i]
+            && product_dense[i] == dense[i] * other[i] && axpy[i] == other[i] + 2.0 * dense[i];
+    std::cout << (ok ? "Sparse vector ops passed!" : "Error: sparse vector mismatch") << std::endl;
+
+    // Skewed matrix: row 0 is dense, the others hold a few entries, and every
+    // triplet appears twice so that duplicates get summed
+    const size_t rows = 3000, cols = 4000;
+    Lp_parallel_vector<size_t> ri, ci;
+    Lp_parallel_vector<double> vi;
+    Lp_parallel_matrix<double> reference(rows, cols);
+    for (size_t c = 0; c < cols; c++) {
+        ri.push_back(0); ci.push_back(c); vi.push_back(1.0);
+    }
+    for (size_t r = 1; r < rows; r += 1 + r % 3) {
+        for (size_t t = 0; t < r % 6; t++) {
+            ri.push_back(r); ci.push_back((r * 31 + t * 977) % cols); vi.push_back(static_cast<double>(t) + 0.5);
+        }
+    }
+    size_t single = ri.size();
+    for (size_t k = 0; k < single; k++) {
+        ri.push_back(ri[k]); ci.push_back(ci[k]); vi.push_back(vi[k]);
+        reference(ri[k], ci[k]) += 2.0 * vi[k];
+    }
+    ri.push_back(rows); ci.push_back(0); vi.push_back(5.0);
+    Lp_csr_matrix<double> a = Lp_csr_from_triplets(rows, cols, ri, ci, vi);
+    Lp_csr_matrix<double> b = Lp_csr_from_dense(reference);
+    ok = a.row_offsets.size() == rows + 1 && std::equal(a.row_offsets.begin(), a.row_offsets.end(), b.row_offsets.begin())
+        && std::equal(a.col_indices.begin(), a.col_indices.end(), b.col_indices.begin(), b.col_indices.end())
+        && std::equal(a.values.begin(), a.values.end(), b.values.begin(), b.values.end());
+
+    Lp_parallel_vector<double> x(cols), y(rows);
+    x.fill([](double& val, size_t index) { (void)val; return static_cast<double>(index % 3); });
+    y.fill(1.0);
+    Lp_parallel_vector<double> expected(rows);
+    Lp_gemv(1.0, reference.view(), x, 0.0, expected);
+    Lp_parallel_vector<double> spmv = Lp_spmv(a, x);
+    Lp_spmv(2.0, a, x, 3.0, y);
+    for (size_t r = 0; ok && r < rows; r++)
+        ok = spmv[r] == expected[r] && y[r] == 2.0 * expected[r] + 3.0;
+    std::cout << (ok ? "Lp_csr_from_triplets/Lp_spmv passed!" : "Error: CSR/SpMV mismatch") << std::endl;
+}
+
+void test_random() {
+    std::cout << "\nTesting Lp_fill_random_*..." << std::endl;
+    // Known-answer vectors of the Random123 reference implementation
+    Lp_philox_block zero = Lp_philox4x32(0, 0, 0);
+    Lp_philox_block ones = Lp_philox4x32(~0ull, ~0ull, ~0ull);
+    Lp_philox_block pi = Lp_philox4x32(0x85a308d3243f6a88ull, 0x0370734413198a2eull, 0x299f31d0a4093822ull);
+    bool ok = zero.word[0] == 0x6627e8d5u && zero.word[1] == 0xe169c58du && zero.word[2] == 0xbc57ac4cu && zero.word[3] == 0x9b00dbd8u
+        && ones.word[0] == 0x408f276du && ones.word[1] == 0x41c83b0eu && ones.word[2] == 0xa20bc7c6u && ones.word[3] == 0x6d5451fdu
+        && pi.word[0] == 0xd16cfe09u && pi.word[1] == 0x94fdccebu && pi.word[2] == 0x5001e420u && pi.word[3] == 0x24126ea1u;
+
+    const size_t n = 1000003;
+    Lp_parallel_vector<int> ints(n);
+    Lp_parallel_vector<double> reals(n), normals(n);
+    Lp_parallel_vector<float> floats(n);
+    Lp_parallel_vector<bool> coins(n);
+    Lp_fill_random_uniform(ints, -5, 5, 1);
+    Lp_fill_random_uniform(reals, 2.0, 4.0, 2);
+    Lp_fill_random_uniform(floats, -1.0f, 1.0f, 3);
+    Lp_fill_random_normal(normals, 10.0, 2.0, 4);
+    Lp_fill_random_bernoulli(coins, 0.25, 5);
+
+    double int_mean = 0, real_mean = 0, normal_mean = 0, normal_var = 0, heads = 0;
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = ints[i] >= -5 && ints[i] <= 5 && reals[i] >= 2.0 && reals[i] < 4.0 && floats[i] >= -1.0f && floats[i] < 1.0f;
+        int_mean += ints[i];
+        real_mean += reals[i];
+        normal_mean += normals[i];
+        normal_var += (normals[i] - 10.0) * (normals[i] - 10.0);
+        heads += coins[i] ? 1 : 0;
+    }
+    ok = ok && std::fabs(int_mean / n) < 0.02 && std::fabs(real_mean / n - 3.0) < 0.01
+        && std::fabs(normal_mean / n - 10.0) < 0.01 && std::fabs(std::sqrt(normal_var / n) - 2.0) < 0.01
+        && std::fabs(heads / n - 0.25) < 0.002;
+
+    // One ulp wide: low + width * u rounds up to high for about half of the
+    // draws, which must be clamped back into [low, high)
+    Lp_parallel_vector<float> narrow(n);
+    Lp_parallel_vector<double> narrow_reals(n);
+    Lp_fill_random_uniform(narrow, 100.0f, std::nextafter(100.0f, 200.0f), 6);
+    Lp_fill_random_uniform(narrow_reals, 1e6, std::nextafter(1e6, 2e6), 7);
+    ok = ok && std::count(narrow.begin(), narrow.end(), 100.0f) == static_cast<std::ptrdiff_t>(n)
+        && std::count(narrow_reals.begin(), narrow_reals.end(), 1e6) == static_cast<std::ptrdiff_t>(n);
+    std::cout << (ok ? "Random distributions passed!" : "Error: random distribution mismatch") << std::endl;
+
+    // Every element depends only on the seed and its index: the checksums are
+    // the same for any number of threads
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < n; i++)
+        checksum = checksum * 31 + static_cast<uint64_t>(ints[i] + 5) + static_cast<uint64_t>(reals[i] * 1e6) + (coins[i] ? 7 : 0)
+            + static_cast<uint64_t>(normals[i] * 1e6);
+    std::cout << (checksum == 4369580555415865956ull ? "Random reproducibility passed!" : "Error: random checksum mismatch") << std::endl;
+}
+
+void test_dirty_tracking() {
+    std::cout << "\nTesting dirty-range tracking and Lp_derive..." << std::endl;
+    const size_t n = 1000000;
+    Lp_parallel_vector<double> a(n), b(n);
+    a.fill([](double& val, size_t index) { (void)val; return static_cast<double>(index); });
+    b.fill(1.0);
+    a.enable_dirty_tracking();
+    b.enable_dirty_tracking();
+
+    auto sum = Lp_derive([](double x, double y) { return x + y; }, a, b);
+    auto scaled = Lp_derive([](double x) { return 2.0 * x; }, a);
+    auto check = [&]() {
+        const Lp_parallel_vector<double>& s = sum.get();
+        const Lp_parallel_vector<double>& d = scaled.get();
+        for (size_t i = 0; i < n; i++)
+            if (s[i] != a[i] + b[i] || d[i] != 2.0 * a[i])
+                return false;
+        return true;
+    };
+    bool ok = check() && sum.last_recomputed() == n;
+
+    // A handful of writes only touch their own chunks, for every reader
+    a.set(10, -1.0);
+    a.set(500000, -2.0);
+    b.update_range(999990, n, [](double& val, size_t index) { val = static_cast<double>(index % 7); });
+    ok = ok && check() && sum.last_recomputed() == 3 * Lp_min_block_size - (Lp_min_block_size - n % Lp_min_block_size)
+        && scaled.last_recomputed() == 2 * Lp_min_block_size;
+    ok = ok && check() && sum.last_recomputed() == 0;
+
+    // Raw writes need mark_dirty; fill and untracked sources recompute everything
+    a[123456] = 7.0;
+    a.mark_dirty(123456, 123457);
+    ok = ok && check() && sum.last_recomputed() == Lp_min_block_size;
+    b.fill(3.0);
+    ok = ok && check() && sum.last_recomputed() == n;
+    b.disable_dirty_tracking();
+    ok = ok && check() && sum.last_recomputed() == n && scaled.last_recomputed() == 0;
+    std::cout << (ok ? "Lp_derive incremental refresh passed!" : "Error: incremental refresh mismatch") << std::endl;
+}
+
+void test_if_parallel() {
+    std::cout << "\nTesting Lp_if_parallel, Lp_if_parallel_runs and Lp_if_parallel_batches..." << std::endl;
+    const size_t n = 300000;
+    Lp_parallel_vector<int> vec(n);
+    vec.fill([](int& val, size_t index) { (void)val; return static_cast<int>(index % 1000 < 700 ? 1 : index % 3); });
+    Lp_parallel_vector<bool> mask = vec == 1;
+    size_t expected = 0;
+    for (size_t i = 0; i < n; i++)
+        expected += mask[i] ? 1 : 0;
+
+    std::atomic<size_t> calls(0);
+    Lp_parallel_vector<int> hits(n);
+    Lp_if_parallel(mask, [&hits, &calls](size_t index) {
+        hits[index] = 1;
+        calls++;
+    });
+    bool ok = calls == expected;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = hits[i] == (mask[i] ? 1 : 0);
+
+    std::atomic<size_t> covered(0), runs(0);
+    Lp_parallel_vector<int> run_hits(n);
+    Lp_if_parallel_runs(mask, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            run_hits[i] += 1;
+        covered += last - first;
+        runs++;
+    });
+    ok = ok && covered == expected && runs < expected / 2;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = run_hits[i] == hits[i];
+
+    std::atomic<size_t> batched(0);
+    Lp_parallel_vector<int> batch_hits(n);
+    Lp_if_parallel_batches(mask, [&](const size_t* indices, size_t count) {
+        for (size_t k = 0; k < count; k++)
+            batch_hits[indices[k]] += 1;
+        batched += count;
+    }, 256);
+    ok = ok && batched == expected;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = batch_hits[i] == hits[i];
+    std::cout << (ok ? "Lp_if_parallel variants passed!" : "Error: Lp_if_parallel mismatch") << std::endl;
+}
+
+void test_executor() {
+    std::cout << "\nTesting the shared executor with nested and concurrent calls..." << std::endl;
+    std::mutex ids_mutex;
+    std::set<std::thread::id> ids;
+    auto record = [&ids_mutex, &ids]() {
+        std::lock_guard<std::mutex> lock(ids_mutex);
+        ids.insert(std::this_thread::get_id());
+    };
+
+    // Nested: every selected index runs element-wise operators of its own
+    const size_t outer = 64 * 4096;
+    Lp_parallel_vector<bool> mask(outer);
+    for (size_t i = 0; i < outer; i += 4096)
+        mask[i] = true;
+    Lp_parallel_vector<long long> a(20000), b(20000);
+    a.fill([](long long& val, size_t index) { (void)val; return static_cast<long long>(index); });
+    b.fill(3);
+    std::atomic<size_t> nested_errors(0);
+    Lp_if_parallel(mask, [&](size_t index) {
+        (void)index;
+        Lp_parallel_vector<long long> c = a + b;
+        c.fill([&record](long long& val, size_t j) { (void)j; record(); return val; });
+        for (size_t j = 0; j < c.size(); j++)
+            if (c[j] != static_cast<long long>(j) + 3)
+                nested_errors++;
+    });
+    bool ok = nested_errors == 0 && ids.size() <= Lp_num_threads();
+
+    // Several callers at once share the same workers
+    ids.clear();
+    std::vector<std::thread> callers;
+    std::atomic<size_t> caller_errors(0);
+    for (int t = 0; t < 4; t++)
+        callers.emplace_back([&, t]() {
+            for (int round = 0; round < 5; round++) {
+                Lp_parallel_vector<long long> c = a * b;
+                c.fill([&record, t](long long& val, size_t j) { (void)j; record(); return val + t; });
+                for (size_t j = 0; j < c.size(); j += 997)
+                    if (c[j] != 3 * static_cast<long long>(j) + t)
+                        caller_errors++;
+            }
+        });
+    for (auto& caller : callers)
+        caller.join();
+    ok = ok && caller_errors == 0 && ids.size() <= Lp_num_threads() + callers.size();
+
+    // A scope caps how many threads work on each call
+    std::atomic<size_t> active(0), peak(0);
+    {
+        Lp_execution_scope scope(Lp_priority::low, 2);
+        Lp_parallel_for_tasks(64, [&](size_t task) {
+            (void)task;
+            size_t now = ++active;
+            size_t seen = peak.load();
+            while (now > seen && !peak.compare_exchange_weak(seen, now)) {}
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            active--;
+        });
+    }
+    ok = ok && peak <= 2 && Lp_executor::settings().max_threads == 0;
+
+    // The first exception thrown by a task reaches the caller
+    bool caught = false;
+    try {
+        Lp_parallel_for_tasks(32, [](size_t task) {
+            if (task == 5)
+                throw std::runtime_error("task failed");
+        });
+    } catch (const std::runtime_error&) {
+        caught = true;
+    }
+    ok = ok && caught;
+    std::cout << (ok ? "Shared executor passed!" : "Error: shared executor mismatch") << std::endl;
+}
+
+void test_cancellation() {
+    std::cout << "\nTesting cancellation tokens and deadlines..." << std::endl;
+    const size_t n = 1000000;
+    Lp_parallel_vector<int> a(n), b(n);
+    a.fill(1);
+    b.fill(2);
+
+    // A live token lets the call finish and reports one full range
+    Lp_cancel_token live;
+    bool ok;
+    {
+        Lp_cancel_scope scope(live);
+        Lp_parallel_vector<int> c = a + b;
+        ok = scope.status().complete() && scope.status().completed.size() == 1 &&
+             scope.status().completed_count() == n && c[n - 1] == 3;
+    }
+
+    // A cancelled token stops before the first chunk
+    Lp_cancel_token stopped;
+    stopped.cancel();
+    {
+        Lp_cancel_scope scope(stopped);
+        Lp_parallel_vector<int> c = a * b;
+        ok = ok && !scope.status().complete() && scope.status().completed_count() == 0;
+    }
+
+    // Cancelling mid-way leaves exactly the completed ranges written
+    Lp_cancel_token token;
+    Lp_run_status status = a.fill([&token](int& val, size_t index) {
+        if (index == 3 * Lp_cancel_chunk)
+            token.cancel();
+        return val + 10;
+    }, token);
+    ok = ok && status.cancelled && status.completed_count() > 0 && status.completed_count() < n;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = a[i] == (status.is_completed(i) ? 11 : 1);
+
+    // Lp_if_parallel only visits positions inside the completed ranges
+    Lp_parallel_vector<bool> mask = b == 2;
+    Lp_cancel_token if_token;
+    std::atomic<size_t> calls(0);
+    std::vector<char> seen(n, 0);
+    status = Lp_if_parallel(mask, [&](size_t index) {
+        seen[index] = 1;
+        if (++calls == 2 * Lp_cancel_chunk)
+            if_token.cancel();
+    }, if_token);
+    ok = ok && status.cancelled && calls == status.completed_count();
+    for (size_t i = 0; ok && i < n; i++)
+        ok = (seen[i] == 1) == status.is_completed(i);
+
+    // An expired deadline leaves the sort input untouched
+    Lp_parallel_vector<int> values(200000);
+    Lp_fill_random_uniform(values, 0, 1000000, 7);
+    Lp_parallel_vector<int> original = values;
+    auto less = std::function<bool(int, int)>([](int x, int y) { return x < y; });
+    Lp_cancel_token expired(std::chrono::steady_clock::duration::zero());
+    status = Lp_sort(values, less, expired);
+    ok = ok && status.cancelled && status.completed.empty() &&
+         std::equal(values.begin(), values.end(), original.begin());
+
+    Lp_cancel_token generous(std::chrono::hours(1));
+    status = Lp_sort(values, less, generous);
+    ok = ok && status.complete() && std::is_sorted(values.begin(), values.end());
+    std::cout << (ok ? "Cancellation and deadlines passed!" : "Error: cancellation mismatch") << std::endl;
+}
+
+void test_static_vector() {
+    std::cout << "\nTesting Lp_static_vector and batch operations..." << std::endl;
+    // Evaluated at compile time
+    constexpr Lp_static_vector<int, 4> a{1, 2, 3, 4};
+    constexpr Lp_static_vector<int, 4> b{4, 3, 2};
+    constexpr auto c = a * 2 + b;
+    static_assert(c[0] == 6 && c[3] == 8, "constexpr arithmetic");
+    static_assert(Lp_dot(a, b) == 16 && Lp_sum(a) == 10, "constexpr reductions");
+    static_assert((a < b)[0] && !(a < b)[3] && (a == 3)[2], "constexpr comparisons");
+    static_assert(sizeof(Lp_static_vector<float, 3>) == 3 * sizeof(float), "no overhead");
+
+    Lp_static_vector<float, 5> v;
+    v.fill([](float& val, size_t index) { (void)val; return static_cast<float>(index); });
+    v = v * v - 1.0f;
+    bool ok = v[4] == 15.0f && Lp_sum(v) == 25.0f;
+    v.fill(2.0f);
+    ok = ok && Lp_sum(v) == 10.0f && (~Lp_static_vector<unsigned, 2>{0u, 1u})[1] == ~1u;
+
+    // The batch parallelizes across many small vectors
+    const size_t n = 100000;
+    Lp_static_batch<double, 3> p(n), q(n);
+    Lp_batch_apply(p, [](Lp_static_vector<double, 3>& item, size_t i) { item = {double(i), 1.0, 2.0}; });
+    q.fill(Lp_static_vector<double, 3>{0.5, 0.5, 0.5});
+    Lp_static_batch<double, 3> r = p + q;
+    Lp_parallel_vector<double> dots = Lp_batch_map(r, q, [](const Lp_static_vector<double, 3>& x, const Lp_static_vector<double, 3>& y) { return Lp_dot(x, y); });
+    Lp_parallel_vector<bool> far = Lp_batch_map(p, [](const Lp_static_vector<double, 3>& x) { return Lp_dot(x, x) > 1e6; });
+    ok = ok && dots.size() == n && far.size() == n;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = dots[i] == 0.5 * (i + 0.5) + 0.75 + 1.25 && far[i] == (double(i) * i + 5.0 > 1e6);
+    std::cout << (ok ? "Lp_static_vector and batches passed!" : "Error: Lp_static_vector mismatch") << std::endl;
+}
+
+// Second process of test_shared_memory: attaches to the segment read-only
+// and checks it with the shared-vector kernels.
+int shared_memory_child(const std::string& name, size_t n) {
+    Lp_shared_vector<double> shared;
+    Lp_shared_vector<float> wrong_type;
+    if (!Lp_shared_attach(name, shared) || shared.writable() || shared.size() != n)
+        return 1;
+    if (Lp_shared_attach(name, wrong_type))
+        return 2;
+    Lp_parallel_vector<double> twice = shared.map([](double x) { return x + x; });
+    if (Lp_sum(shared) != 0.5 * (double(n) * (n - 1) / 2) || twice[n - 1] != double(n - 1))
+        return 3;
+    return 0;
+}
+
+void test_shared_memory(const char* self) {
+    std::cout << "\nTesting shared-memory vectors across two processes..." << std::endl;
+    const size_t n = 1000000;
+    std::string name = "test." + std::to_string(getpid());
+    Lp_shared_vector<double> built;
+    bool ok = Lp_shared_create(name, n, built) && built.writable() && built.size() == n && built[n - 1] == 0.0;
+    Lp_shared_vector<double> early;
+    ok = ok && !Lp_shared_attach(name, early);  // not published yet
+    ok = ok && built.fill([](double& val, size_t index) { (void)val; return 0.5 * index; });
+    ok = ok && Lp_shared_publish(built);
+
+    // Kernel results and to_vector() are ordinary heap vectors
+    Lp_parallel_vector<double> copy = built.to_vector();
+    ok = ok && copy.size() == n && copy[n - 1] == built[n - 1];
+
+    int status = -1;
+    std::string count = std::to_string(n);
+    char* args[] = {const_cast<char*>(self), const_cast<char*>("--shm-child"), const_cast<char*>(name.c_str()),
+                    const_cast<char*>(count.c_str()), nullptr};
+    pid_t child;
+    if (ok && posix_spawn(&child, self, nullptr, nullptr, args, environ) == 0)
+        waitpid(child, &status, 0);
+    ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    // A read-only view refuses writes and can be replaced wholesale
+    Lp_shared_vector<double> view;
+    ok = ok && Lp_shared_attach(name, view) && !view.writable();
+    ok = ok && !view.fill(1.0) && !view.copy_from(copy) && view.mutable_data() == nullptr;
+    Lp_parallel_vector<bool> upper = view.map([n](double x) { return x >= 0.25 * n; });
+    Lp_parallel_vector<double> kept = Lp_filter(view, upper);
+    ok = ok && kept.size() == n / 2 && kept[0] == 0.25 * n;
+    Lp_shared_vector<double> fresh = built;
+    view = std::move(fresh);
+    ok = ok && view.writable() && view.data() == built.data();
+    view = Lp_shared_vector<double>();
+    ok = ok && view.empty() && view.data() == nullptr;
+    copy = Lp_filter(copy, upper);
+    ok = ok && copy.size() == n / 2;
+
+    ok = ok && Lp_shared_unlink(name);
+    Lp_shared_vector<double> gone;
+    ok = ok && !Lp_shared_attach(name, gone) && built[1] == 0.5;
+    Lp_shared_detach(built);
+    ok = ok && built.empty() && !built.shm_segment();
+    std::cout << (ok ? "Shared-memory vectors passed!" : "Error: shared-memory mismatch") << std::endl;
+}
+
+void test_stream() {
+    std::cout << "\nTesting Lp_stream chunked pipelines..." << std::endl;
+    const size_t n = 2500000;
+    const size_t chunk = 100000;
+
+    // Generated input: stages and reductions per chunk, constant buffer size
+    std::atomic<size_t> largest_request(0);
+    auto generate = Lp_stream_from_function<long long>(n, [](size_t i) { return static_cast<long long>(i % 1000); });
+    Lp_stream<long long> stream([&](long long* out, size_t max) {
+        largest_request = std::max<size_t>(largest_request, max);
+        return generate(out, max);
+    }, chunk, 3);
+    long long expected = 0;
+    for (size_t i = 0; i < n; i++)
+        expected += 2 * static_cast<long long>(i % 1000) + 1;
+    bool ok = stream.map([](long long x) { return 2 * x + 1; }).sum() == expected && largest_request == chunk &&
+              stream.elements_read() == n;
+
+    // Length-changing stage and chunk offsets
+    Lp_stream<int> evens(Lp_stream_from_function<int>(n, [](size_t i) { return static_cast<int>(i); }), chunk);
+    evens.apply([](Lp_parallel_vector<int>& c) { c = Lp_filter(c, c % 2 == 0); });
+    size_t next_offset = 0;
+    bool offsets_ok = true;
+    evens.for_each([&](const Lp_parallel_vector<int>& c, size_t offset) {
+        offsets_ok = offsets_ok && offset == next_offset && c.size() == chunk / 2 && c[0] == static_cast<int>(offset);
+        next_offset += chunk;
+    });
+    ok = ok && offsets_ok && next_offset == n;
+
+    // File input
+    std::string path = "leopard_stream_test.bin";
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    for (size_t i = 0; i < n; i++) {
+        double value = 0.25 * (i % 7);
+        std::fwrite(&value, sizeof(value), 1, file);
+    }
+    std::fclose(file);
+    Lp_stream<double> from_file(Lp_stream_from_file<double>(path), chunk);
+    double file_expected = 0;
+    for (size_t i = 0; i < n; i++)
+        file_expected += 0.25 * (i % 7);
+    ok = ok && from_file.sum() == file_expected;
+
+    // A file that cannot be opened is an error, not an empty stream
+    Lp_stream<double> missing(Lp_stream_from_file<double>("leopard_missing_file.bin"), chunk);
+    bool threw = false;
+    try {
+        missing.sum();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    ok = ok && threw;
+
+    // Cancellation stops between chunks
+    Lp_cancel_token token;
+    Lp_stream<int> cancelled(Lp_stream_from_function<int>(n, [](size_t i) { return static_cast<int>(i); }), chunk);
+    size_t chunks_seen = 0;
+    {
+        Lp_cancel_scope scope(token);
+        cancelled.for_each([&](const Lp_parallel_vector<int>& c, size_t offset) {
+            (void)c;
+            (void)offset;
+            if (++chunks_seen == 3)
+                token.cancel();
+        });
+    }
+    ok = ok && chunks_seen == 3;
+    std::remove(path.c_str());
+    std::cout << (ok ? "Lp_stream passed!" : "Error: Lp_stream mismatch") << std::endl;
+}
+
+void test_segmented_vector() {
+    std::cout << "\nTesting Lp_segmented_vector..." << std::endl;
+    const size_t n = 300000;
+    Lp_segmented_vector<int> a(0, 4096);
+    a.push_back(0);
+    const int* first = &a[0];
+    for (size_t i = 1; i < n; i++)
+        a.push_back(static_cast<int>(i));
+    bool ok = a.size() == n && &a[0] == first && a.segment_size() == 4096 && a.num_segments() == (n + 4095) / 4096;
+
+    // Operators run per segment and match the contiguous ones
+    Lp_parallel_vector<int> flat = a.flatten();
+    Lp_segmented_vector<int> b(flat, 1000);  // rounded up to 1024
+    Lp_segmented_vector<int> sum = a + b * 2;
+    Lp_segmented_vector<bool> small = a < 1000;
+    Lp_parallel_vector<int> flat_sum = flat + flat * 2;
+    ok = ok && b.segment_size() == 1024 && sum.size() == n && small.size() == n;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = sum[i] == flat_sum[i] && small[i] == (i < 1000);
+
+    a.fill([](int& val, size_t index) { return val - static_cast<int>(index) + 7; });
+    Lp_parallel_vector<int> tail(5000);
+    tail.fill(9);
+    a.append(tail.begin(), tail.end());
+    a.resize(n + 6000);
+    ok = ok && a.size() == n + 6000 && a[n - 1] == 7 && a[n] == 9 && a[n + 4999] == 9 && a[n + 5999] == 0;
+    a.resize(10);
+    a.shrink_to_fit();
+    ok = ok && a.num_segments() == 1 && a.back() == 7;
+
+    // Non-trivial elements are constructed and destroyed once
+    Lp_segmented_vector<std::string> names(0, 64);
+    for (int i = 0; i < 1000; i++)
+        names.emplace_back("name" + std::to_string(i));
+    Lp_segmented_vector<std::string> copy = names;
+    names.clear();
+    ok = ok && copy.size() == 1000 && copy[999] == "name999" && names.empty();
+    std::cout << (ok ? "Lp_segmented_vector passed!" : "Error: Lp_segmented_vector mismatch") << std::endl;
+}
+
+void test_concurrent_builder() {
+    std::cout << "\nTesting Lp_concurrent_builder..." << std::endl;
+    const size_t n = 1000000;
+    Lp_parallel_vector<int> values(n);
+    Lp_fill_random_uniform(values, 0, 99, 11);
+    Lp_parallel_vector<bool> mask = values < 50;
+    Lp_parallel_vector<size_t> expected = Lp_where(mask);
+
+    // Appends from Lp_if_parallel into a large enough output: handed over as is
+    Lp_concurrent_builder<size_t> builder(n);
+    Lp_if_parallel(mask, [&builder](size_t index) { builder.push_back(index); });
+    Lp_parallel_vector<size_t> hits = builder.finalize();
+    bool ok = hits.size() == expected.size() && hits.capacity() == n;
+    std::sort(hits.begin(), hits.end());
+    ok = ok && std::equal(hits.begin(), hits.end(), expected.begin());
+    // Reuse allocates the output again on the first append
+    Lp_if_parallel(mask, [&builder](size_t index) { builder.push_back(index); });
+    Lp_parallel_vector<size_t> reused = builder.finalize();
+    std::sort(reused.begin(), reused.end());
+    ok = ok && reused.capacity() == n && std::equal(reused.begin(), reused.end(), expected.begin());
+    ok = ok && builder.finalize().empty();
+
+    // A hint that is too small spills the rest per producer; reuse works
+    Lp_concurrent_builder<size_t> small(expected.size() / 3, 256);
+    for (int round = 0; round < 2; round++) {
+        Lp_if_parallel(mask, [&small](size_t index) { small.emplace_back(index); });
+        Lp_parallel_vector<size_t> spilled = small.finalize();
+        std::sort(spilled.begin(), spilled.end());
+        ok = ok && spilled.size() == expected.size() && std::equal(spilled.begin(), spilled.end(), expected.begin());
+    }
+
+    // by_producer keeps every producer's elements together and in order
+    Lp_concurrent_builder<long long> ordered(0, 100);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++)
+        producers.emplace_back([&ordered, t]() {
+            for (long long k = 0; k < 10000; k++)
+                ordered.push_back(t * 1000000LL + k);
+        });
+    for (auto& producer : producers)
+        producer.join();
+    Lp_parallel_vector<long long> grouped = ordered.finalize(Lp_builder_order::by_producer);
+    ok = ok && grouped.size() == 40000;
+    for (size_t i = 0; ok && i < grouped.size(); i++)
+        ok = grouped[i] % 1000000 == static_cast<long long>(i % 10000) &&
+             (i % 10000 == 0 || grouped[i] == grouped[i - 1] + 1);
+    std::cout << (ok ? "Lp_concurrent_builder passed!" : "Error: Lp_concurrent_builder mismatch") << std::endl;
+}
+
+// Code written against std::vector, as in user code taking the base class.
+static double last_of(const std::vector<double>& vec) {
+    return vec.empty() ? 0.0 : vec.back();
+}
+
+void test_std_vector_interop() {
+    std::cout << "\nTesting Lp_parallel_vector as a std::vector..." << std::endl;
+    Lp_parallel_vector<double> values = {3.0, 1.0, 2.0};
+    bool ok = last_of(values) == 2.0;
+    std::vector<double>& base = values;
+    base.push_back(4.0);
+    ok = ok && values.size() == 4 && last_of(values) == 4.0;
+
+    Lp_parallel_vector<int> keys = {5, -1, 3, 3, 0, 9, -7};
+    Lp_sequential_quicksort<int>(keys, 0, keys.size() - 1, [](int a, int b) { return a < b; });
+    ok = ok && std::is_sorted(keys.begin(), keys.end());
+
+    // Lp_parallel_quicksort splits on the shared executor
+    Lp_parallel_vector<int> many(200000);
+    many.fill([](int& val, size_t index) { (void)val; return static_cast<int>((index * 2654435761u) % 10007); });
+    std::vector<std::thread> unused;
+    size_t thread_count = 0;
+    Lp_parallel_quicksort<int>(many, 0, many.size() - 1, [](int a, int b) { return a < b; }, 6, unused, thread_count, 8);
+    ok = ok && std::is_sorted(many.begin(), many.end()) && thread_count == 0 && unused.empty();
+    std::cout << (ok ? "std::vector interop passed!" : "Error: std::vector interop mismatch") << std::endl;
+}
+
+void test_bulk_copy() {
+    std::cout << "\nTesting parallel bulk copy, assign and construction..." << std::endl;
+    // 32 MB of doubles: above Lp_streaming_threshold, so copies stream
+    const size_t n = 4000000;
+    Lp_parallel_vector<double> source(n);
+    bool ok = source.size() == n && source[0] == 0.0 && source[n - 1] == 0.0;
+    source.fill([](double& val, size_t index) { (void)val; return 0.25 * index; });
+    auto same = [&source](const Lp_parallel_vector<double>& vec) {
+        return vec.size() == source.size() && std::equal(vec.begin(), vec.end(), source.begin());
+    };
+
+    Lp_parallel_vector<double> copy = source;
+    ok = ok && same(copy);
+    Lp_parallel_vector<double> assigned(10);
+    assigned = source;
+    ok = ok && same(assigned);
+
+    // Unaligned pointer ranges, other random-access iterators and std::vector
+    Lp_parallel_vector<double> tail;
+    tail.assign(source.data() + 3, source.data() + n);
+    ok = ok && tail.size() == n - 3 && tail[0] == source[3] && tail[n - 4] == source[n - 1];
+    std::vector<float> narrow(n, 1.5f);
+    Lp_parallel_vector<double> widened;
+    widened.assign(narrow.begin(), narrow.end());
+    ok = ok && widened.size() == n && widened[n - 1] == 1.5;
+    std::vector<double> plain(source.begin(), source.end());
+    Lp_parallel_vector<double> converted(plain);
+    ok = ok && same(converted);
+    converted.assign(n / 2, -1.0);
+    ok = ok && converted.size() == n / 2 && converted[0] == -1.0 && converted[n / 2 - 1] == -1.0;
+    converted = plain;
+    ok = ok && same(converted);
+
+    // Copies and assign ignore a cancelled scope: they always complete and
+    // never expose the stale contents of a reused block
+    {
+        Lp_parallel_vector<double> junk(n);
+        junk.fill(42.0);
+    }
+    Lp_cancel_token cancelled;
+    cancelled.cancel();
+    {
+        Lp_cancel_scope scope(cancelled);
+        Lp_parallel_vector<double> sevens;
+        sevens.assign(n, 7.0);
+        Lp_parallel_vector<double> widened_again;
+        widened_again.assign(narrow.begin(), narrow.end());
+        Lp_parallel_vector<double> copied = source;
+        ok = ok && sevens.size() == n && std::count(sevens.begin(), sevens.end(), 7.0) == static_cast<std::ptrdiff_t>(n);
+        ok = ok && std::count(widened_again.begin(), widened_again.end(), 1.5) == static_cast<std::ptrdiff_t>(n);
+        ok = ok && same(copied) && !scope.status().cancelled && scope.status().completed.empty();
+    }
+
+    // Small and non-trivial element types keep the element-wise path
+    Lp_parallel_vector<std::string> words;
+    words.assign(3, "leopard");
+    Lp_parallel_vector<std::string> words_copy = words;
+    ok = ok && words_copy.size() == 3 && words_copy[2] == "leopard";
+
+    // Lp_sort copies in and back with the bulk path
+    Lp_parallel_vector<int> keys(n);
+    Lp_fill_random_uniform(keys, 0, 1000000, 5);
+    std::vector<int> expected(keys.begin(), keys.end());
+    std::sort(expected.begin(), expected.end());
+    Lp_sort(keys, std::function<bool(int, int)>([](int x, int y) { return x < y; }));
+    ok = ok && std::equal(keys.begin(), keys.end(), expected.begin());
+    std::cout << (ok ? "Bulk copy passed!" : "Error: bulk copy mismatch") << std::endl;
+}
+
+void test_select() {
+    std::cout << "\nTesting Lp_select and assign_where..." << std::endl;
+    const size_t n = 1000003;
+    Lp_parallel_vector<float> x(n);
+    Lp_fill_random_uniform(x, -1.0f, 1.0f, 9);
+    Lp_parallel_vector<float> limit(n);
+    limit.fill(0.5f);
+
+    // Comparison results are used directly as masks
+    Lp_parallel_vector<float> clamped = Lp_select(x > limit, limit, x);
+    Lp_parallel_vector<float> relu = Lp_select(x > 0.0f, x, 0.0f);
+    Lp_parallel_vector<float> sign = Lp_select(x < 0.0f, -1.0f, limit);
+    bool ok = clamped.size() == n && relu.size() == n && sign.size() == n;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = clamped[i] == std::min(x[i], 0.5f) && relu[i] == std::max(x[i], 0.0f) && sign[i] == (x[i] < 0.0f ? -1.0f : 0.5f);
+
+    // Masked assignment matches the Lp_if_parallel formulation
+    Lp_parallel_vector<float> expected = x;
+    Lp_parallel_vector<bool> mask = x < -0.25f;
+    Lp_if_parallel(mask, [&expected, &limit](size_t i) { expected[i] = limit[i]; });
+    Lp_parallel_vector<float> updated = x;
+    updated.assign_where(mask, limit);
+    ok = ok && std::equal(updated.begin(), updated.end(), expected.begin());
+    updated.assign_where(x > 0.75f, 2.0f);
+    for (size_t i = 0; ok && i < n; i++)
+        ok = updated[i] == (x[i] > 0.75f ? 2.0f : expected[i]);
+
+    // Min-size semantics, integer masks and boolean values
+    Lp_parallel_vector<int> int_mask(10);
+    int_mask[3] = 7;
+    Lp_parallel_vector<float> short_select = Lp_select(int_mask, x, limit);
+    ok = ok && short_select.size() == 10 && short_select[3] == x[3] && short_select[4] == 0.5f;
+    Lp_parallel_vector<bool> flags = Lp_select(mask, mask, true);
+    flags.assign_where(x > 0.9f, false);
+    for (size_t i = 0; ok && i < n; i++)
+        ok = flags[i] == (x[i] <= 0.9f);
+    std::cout << (ok ? "Masked select passed!" : "Error: masked select mismatch") << std::endl;
+}
+
+template<typename T>
+bool check_compressed(const Lp_parallel_vector<T>& values, Lp_encoding encoding, T lo, T hi) {
+    Lp_compressed_vector<T> column(values, encoding);
+    Lp_parallel_vector<T> decoded = column.decode();
+    bool ok = column.size() == values.size() && decoded.size() == values.size() &&
+              std::equal(decoded.begin(), decoded.end(), values.begin());
+    for (size_t i = 0; ok && i < values.size(); i += 997)
+        ok = column[i] == values[i];
+    if (!values.empty())
+        ok = ok && column[values.size() - 1] == values.back() &&
+             column.min() == *std::min_element(values.begin(), values.end()) &&
+             column.max() == *std::max_element(values.begin(), values.end());
+
+    // Compressed-domain operations against the same operations on raw values
+    // sum() wraps like unsigned arithmetic, also for the int64 extremes below
+    typedef typename std::make_unsigned<T>::type U;
+    U total = 0;
+    for (T value : values)
+        total = static_cast<U>(total + static_cast<U>(value));
+    ok = ok && column.sum() == static_cast<T>(total);
+    Lp_parallel_vector<T> raw = values;
+    Lp_parallel_vector<bool> masks[] = {column < lo, column <= lo, column > hi, column >= hi, column == lo,
+                                        column != lo, column.between(lo, hi)};
+    Lp_parallel_vector<bool> below_hi = raw <= hi;
+    Lp_parallel_vector<bool> expected[] = {raw < lo, raw <= lo, raw > hi, raw >= hi, raw == lo, raw != lo,
+                                           (raw >= lo) & below_hi};
+    for (size_t m = 0; ok && m < 7; m++)
+        ok = masks[m].size() == values.size() && std::equal(masks[m].begin(), masks[m].end(), expected[m].begin());
+    Lp_parallel_vector<T> kept = column.filter(lo, hi);
+    Lp_parallel_vector<T> expected_kept = Lp_filter(raw, expected[6]);
+    ok = ok && kept.size() == expected_kept.size() && std::equal(kept.begin(), kept.end(), expected_kept.begin());
+    ok = ok && column.count_between(lo, hi) == expected_kept.size();
+    return ok;
+}
+
+void test_compressed_vector() {
+    std::cout << "\nTesting Lp_compressed_vector encodings..." << std::endl;
+    const size_t n = 1000003;
+
+    // Sorted IDs with small gaps: delta needs a few bits per element
+    Lp_parallel_vector<uint64_t> ids(n);
+    ids.fill([](uint64_t& val, size_t index) { (void)val; return 1000000000000ULL + 3 * index + index % 3; });
+    bool ok = check_compressed(ids, Lp_encoding::delta, ids[n / 3], ids[n / 2]);
+    ok = ok && check_compressed(ids, Lp_encoding::for_bitpack, ids[n / 3], ids[n / 2]);
+    Lp_compressed_vector<uint64_t> delta_ids(ids, Lp_encoding::delta);
+    ok = ok && delta_ids.compressed_bytes() * 8 < n * sizeof(uint64_t);
+
+    // Small-range counters: frame of reference
+    Lp_parallel_vector<uint32_t> counters(n);
+    Lp_fill_random_uniform(counters, 5000u, 5100u, 21);
+    ok = ok && check_compressed(counters, Lp_encoding::for_bitpack, 5020u, 5050u);
+    Lp_compressed_vector<uint32_t> packed_counters(counters);
+    ok = ok && packed_counters.compressed_bytes() * 4 < n * sizeof(uint32_t);
+
+    // Long runs, and few widely spread (also negative and extreme) values
+    Lp_parallel_vector<int32_t> runs(n);
+    runs.fill([](int32_t& val, size_t index) { (void)val; return static_cast<int32_t>(index / 5000) - 100; });
+    ok = ok && check_compressed(runs, Lp_encoding::rle, -50, 20);
+    ok = ok && check_compressed(runs, Lp_encoding::delta, -50, 20);
+    Lp_parallel_vector<int64_t> codes(n);
+    const int64_t spread[] = {std::numeric_limits<int64_t>::min(), -7, 0, 123456789012LL, std::numeric_limits<int64_t>::max()};
+    codes.fill([&spread](int64_t& val, size_t index) { (void)val; return spread[(index * 7919) % 5]; });
+    ok = ok && check_compressed(codes, Lp_encoding::dictionary, int64_t(-7), int64_t(123456789012LL));
+    ok = ok && check_compressed(codes, Lp_encoding::for_bitpack, int64_t(-7), int64_t(123456789012LL));
+    ok = ok && check_compressed(codes, Lp_encoding::delta, std::numeric_limits<int64_t>::min(), int64_t(0));
+    Lp_compressed_vector<int64_t> dictionary_codes(codes, Lp_encoding::dictionary);
+    ok = ok && dictionary_codes.compressed_bytes() * 16 < n * sizeof(int64_t);
+
+    // Small and empty vectors
+    Lp_parallel_vector<int16_t> tiny = {3, -2, 3, 3};
+    ok = ok && check_compressed(tiny, Lp_encoding::rle, int16_t(-2), int16_t(0)) &&
+         check_compressed(tiny, Lp_encoding::dictionary, int16_t(3), int16_t(3));
+    Lp_compressed_vector<int> none(Lp_parallel_vector<int>(), Lp_encoding::delta);
+    ok = ok && none.empty() && none.decode().empty() && none.sum() == 0 && (none > 3).empty();
+    std::cout << (ok ? "Compressed vectors passed!" : "Error: compressed vector mismatch") << std::endl;
+}
+
+int main(int argc, char** argv)
 {
+    if (argc == 4 && std::string(argv[1]) == "--shm-child")
+        return shared_memory_child(argv[2], std::stoul(argv[3]));
+
     // Test basic constructor and destructor
     std::cout << "Testing basic constructor and destructor..." << std::endl;
     Lp_parallel_vector<int> vec(100000);
@@ -108,6 +1393,33 @@ int main()
     
     // Run stress test for thread safety
     stress_test_thread_safety(1000);
+
+    test_compaction();
+    test_gather_scatter();
+    test_argsort();
+    test_selection();
+    test_sorted_search();
+    test_group_by();
+    test_hash_join();
+    test_dedup_partition();
+    test_math();
+    test_blas1();
+    test_matrix();
+    test_sparse();
+    test_random();
+    test_dirty_tracking();
+    test_if_parallel();
+    test_executor();
+    test_cancellation();
+    test_static_vector();
+    test_shared_memory(argv[0]);
+    test_stream();
+    test_segmented_vector();
+    test_concurrent_builder();
+    test_bulk_copy();
+    test_std_vector_interop();
+    test_select();
+    test_compressed_vector();
     
     // Test the parallel quicksort implementation
     std::cout << "\nTesting parallel quicksort..." << std::endl;
@@ -116,12 +1428,8 @@ int main()
     Lp_parallel_vector<int> sort_vec(10000);
     std::cout << "Filling vector with random values..." << std::endl;
     
-    // Use a lambda to fill with random values
-    sort_vec.fill([](int& val, size_t index) { 
-        (void)index;
-        val = std::rand() % 10000; 
-        return val;
-    });
+    // Same values on every run and for any thread count
+    Lp_fill_random_uniform(sort_vec, 0, 9999, 42);
     
     // Print first few elements before sorting
     std::cout << "First 10 elements before sorting:" << std::endl;